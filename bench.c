@@ -0,0 +1,86 @@
+#include "user.h"
+
+/*
+    microbenchmarks, started from the shell with `bench`
+
+    results are printed as "BENCH <name> <ops> <ticks>" lines between BENCH BEGIN/END so bench.py can pick them out
+    of the console output, ticks are in TIMEBASE_HZ units
+*/
+
+#define SYSCALL_ITERS 10000
+#define YIELD_ITERS 2000
+#define ALLOC_PAGES 256
+#define MEMCPY_ITERS 200
+#define PRINTF_ITERS 100
+#define SNPRINTF_ITERS 2000
+
+uint8_t memcpy_src[PAGE_SIZE];
+uint8_t memcpy_dst[PAGE_SIZE];
+
+void report(const char *name, uint32_t ops, uint32_t ticks) { printf("BENCH %s %d %d\n", name, ops, ticks); }
+
+void bench_syscall(void) {
+    uint32_t start = read_time();
+    for (int i = 0; i < SYSCALL_ITERS; i++) {
+        getpid();
+    }
+    report("syscall", SYSCALL_ITERS, read_time() - start);
+}
+
+void bench_ctx_switch(void) {
+    /* the shell is waiting on us, each yield goes there and back so it is two switches */
+    uint32_t start = read_time();
+    for (int i = 0; i < YIELD_ITERS; i++) {
+        yield();
+    }
+    report("ctx_switch", YIELD_ITERS * 2, read_time() - start);
+}
+
+void bench_page_alloc(void) {
+    /* one page per call so the syscall, allocation, zeroing and mapping are all paid every time */
+    uint32_t start = read_time();
+    for (int i = 0; i < ALLOC_PAGES; i++) {
+        sbrk(1);
+    }
+    report("page_alloc", ALLOC_PAGES, read_time() - start);
+}
+
+void bench_memcpy(void) {
+    uint32_t start = read_time();
+    for (int i = 0; i < MEMCPY_ITERS; i++) {
+        memcpy(memcpy_dst, memcpy_src, PAGE_SIZE);
+        __asm__ __volatile__("" ::: "memory"); /* keep the compiler from merging the copies */
+    }
+    report("memcpy_4k", MEMCPY_ITERS, read_time() - start);
+}
+
+void bench_printf(void) {
+    uint32_t start = read_time();
+    for (int i = 0; i < PRINTF_ITERS; i++) {
+        printf("printf %d %x %s\n", i * 7919, i * 0x9e3779b1, "bench");
+    }
+    report("printf", PRINTF_ITERS, read_time() - start);
+}
+
+/* formatting only, no console in the way */
+void bench_snprintf(void) {
+    char buf[64];
+    uint32_t start = read_time();
+    for (int i = 0; i < SNPRINTF_ITERS; i++) {
+        snprintf(buf, sizeof(buf), "printf %d %x %s\n", i * 7919, i * 0x9e3779b1, "bench");
+    }
+    report("snprintf", SNPRINTF_ITERS, read_time() - start);
+}
+
+void main(void) {
+    printf("BENCH BEGIN %d\n", TIMEBASE_HZ);
+
+    bench_syscall();
+    bench_ctx_switch();
+    bench_page_alloc();
+    bench_memcpy();
+    bench_printf();
+    bench_snprintf();
+
+    printf("BENCH END\n");
+}
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+"""
+Headless benchmark driver.
+
+Builds and boots the kernel through run.sh, types `bench` into the shell, collects the BENCH lines printed by
+bench.c and compares them against a stored baseline.
+
+    ./bench.py                      run and compare against bench_baseline.json
+    ./bench.py --update-baseline    run and store the results as the new baseline
+
+Exits with 1 if any benchmark got slower than the baseline by more than --threshold percent, if a benchmark in the
+baseline didn't run, or if there is no baseline to compare against.
+
+The numbers depend on the host machine and QEMU version (QEMU emulates the cpu), so no baseline is committed:
+create one with --update-baseline on the machine that runs the comparisons and keep it there.
+"""
+
+import argparse
+import json
+import os
+import select
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+
+class Console:
+    """serial console of a qemu started by run.sh"""
+
+    def __init__(self, cmd):
+        self.proc = subprocess.Popen(cmd, cwd=HERE, stdin=subprocess.PIPE, stdout=subprocess.PIPE, bufsize=0)
+        self.output = b""
+
+    def read_until(self, marker, timeout):
+        deadline = time.monotonic() + timeout
+        while marker not in self.output:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                raise TimeoutError("timed out waiting for %r" % marker)
+            ready, _, _ = select.select([self.proc.stdout], [], [], remaining)
+            if ready:
+                chunk = os.read(self.proc.stdout.fileno(), 4096)
+                if not chunk:
+                    raise EOFError("qemu exited while waiting for %r" % marker)
+                self.output += chunk
+
+    def send(self, text):
+        self.proc.stdin.write(text.encode())
+        self.proc.stdin.flush()
+
+    def close(self):
+        self.proc.kill()
+        self.proc.wait()
+
+
+def parse_results(output):
+    """returns {name: ns per op} from the lines between BENCH BEGIN and BENCH END"""
+    timebase = None
+    results = {}
+    for line in output.decode(errors="replace").splitlines():
+        fields = line.strip().split()
+        if len(fields) == 3 and fields[:2] == ["BENCH", "BEGIN"]:
+            timebase = int(fields[2])
+        elif len(fields) == 4 and fields[0] == "BENCH" and timebase:
+            name, ops, ticks = fields[1], int(fields[2]), int(fields[3])
+            results[name] = ticks * 1e9 / timebase / ops
+    return results
+
+
+def compare(results, baseline, threshold):
+    """prints a table and returns the names of the benchmarks that regressed or are missing from the results"""
+    regressions = []
+    print("%-12s %14s %14s %9s" % ("benchmark", "baseline ns", "current ns", "change"))
+    for name, current in results.items():
+        base = baseline.get(name)
+        if base is None:
+            print("%-12s %14s %14.1f %9s" % (name, "-", current, "new"))
+            continue
+
+        change = 100.0 * (current - base) / base
+        flag = ""
+        if change > threshold:
+            flag = "  REGRESSION"
+            regressions.append(name)
+        print("%-12s %14.1f %14.1f %+8.1f%%%s" % (name, base, current, change, flag))
+
+    # a renamed or dropped benchmark would otherwise pass silently
+    for name in sorted(set(baseline) - set(results)):
+        print("%-12s %14.1f %14s %9s  MISSING" % (name, baseline[name], "-", "-"))
+        regressions.append(name)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--run", default="./run.sh", help="command that builds and boots qemu on stdio")
+    parser.add_argument("--baseline", default=os.path.join(HERE, "bench_baseline.json"))
+    parser.add_argument("--output", default=os.path.join(HERE, "bench_results.json"))
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed slowdown in percent")
+    parser.add_argument("--timeout", type=float, default=300.0, help="seconds to wait for the build, boot and run")
+    parser.add_argument("--update-baseline", action="store_true")
+    args = parser.parse_args()
+
+    console = Console(args.run.split())
+    try:
+        console.read_until(b"> ", args.timeout)
+        console.send("bench\r")
+        console.read_until(b"BENCH END", args.timeout)
+    finally:
+        console.close()
+
+    results = parse_results(console.output)
+    if not results:
+        sys.exit("no BENCH results in the console output")
+
+    with open(args.output, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.update_baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print("baseline written to %s" % args.baseline)
+        return
+
+    if not os.path.exists(args.baseline):
+        sys.exit("no baseline at %s, run with --update-baseline to create one" % args.baseline)
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+
+    regressions = compare(results, baseline, args.threshold)
+    if regressions:
+        sys.exit("regressed or missing: %s" % ", ".join(regressions))
+
+
+if __name__ == "__main__":
+    main()
@@ -1,7 +1,7 @@
 #include "common.h"
 
 /* don't like this but whatever */
-extern void putchar(char);
+extern void console_write(const char *buf, size_t len);
 
 void *memcpy(void *dst, const void *src, size_t n) {
     uint8_t *d = (uint8_t *)dst;
@@ -17,7 +17,7 @@ void *memcpy(void *dst, const void *src, size_t n) {
 void *memset(void *buf, char c, size_t n) {
     uint8_t *p = (uint8_t *)buf;
     for (size_t i = 0; i < n; i++) {
-        *p = c;
+        p[i] = c;
     }
     /* this is returned for chaining */
     return buf;
@@ -37,6 +37,14 @@ char *strcpy(char *dst, const char *src) {
     return dst;
 }
 
+size_t strlen(const char *s) {
+    const char *p = s;
+    while (*p) {
+        p++;
+    }
+    return p - s;
+}
+
 int strcmp(const char *s1, const char *s2) {
     while (*s1 && *s2) {
         if (*s1 != *s2) {
@@ -49,72 +57,268 @@ int strcmp(const char *s1, const char *s2) {
     return *s1 - *s2; /* fuck the posix spec */
 }
 
-void printf(const char *fmt, ...) {
-    va_list v_args;
-    va_start(v_args, fmt);
+/* formatted output goes into a buffer, printf flushes it to the console when full, snprintf truncates */
+struct fmt_out {
+    char *buf;
+    size_t size;  /* capacity of buf */
+    size_t len;   /* chars currently in buf */
+    size_t total; /* chars produced, including the ones snprintf had to drop */
+    bool flush;
+};
+
+static void out_char(struct fmt_out *out, char c) {
+    if (out->len == out->size) {
+        if (!out->flush) {
+            out->total++;
+            return;
+        }
+        console_write(out->buf, out->len);
+        out->len = 0;
+    }
+
+    out->buf[out->len++] = c;
+    out->total++;
+}
+
+static void out_str(struct fmt_out *out, const char *s, size_t n) {
+    out->total += n;
+
+    while (n) {
+        if (out->len == out->size) {
+            if (!out->flush) return;
+            console_write(out->buf, out->len);
+            out->len = 0;
+        }
+
+        size_t chunk = out->size - out->len < n ? out->size - out->len : n;
+        memcpy(out->buf + out->len, s, chunk);
+        out->len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+static void out_pad(struct fmt_out *out, char c, int n) {
+    for (int i = 0; i < n; i++) {
+        out_char(out, c);
+    }
+}
+
+static const char digit_pairs[201] = "00010203040506070809"
+                                     "10111213141516171819"
+                                     "20212223242526272829"
+                                     "30313233343536373839"
+                                     "40414243444546474849"
+                                     "50515253545556575859"
+                                     "60616263646566676869"
+                                     "70717273747576777879"
+                                     "80818283848586878889"
+                                     "90919293949596979899";
+
+/* n / 100 as a multiply by the reciprocal, exact for every 32bit n */
+static uint32_t div100(uint32_t n) { return ((uint64_t)n * 0x51eb851f) >> 37; }
 
+/* writes the decimal digits of n right to left ending at end, two at a time, returns where they start */
+static char *utoa_dec(char *end, uint32_t n) {
+    while (n >= 100) {
+        uint32_t q = div100(n);
+        uint32_t r = (n - q * 100) * 2;
+        *--end = digit_pairs[r + 1];
+        *--end = digit_pairs[r];
+        n = q;
+    }
+
+    if (n >= 10) {
+        *--end = digit_pairs[n * 2 + 1];
+        *--end = digit_pairs[n * 2];
+    } else {
+        *--end = '0' + n;
+    }
+    return end;
+}
+
+static char *utoa_hex(char *end, uint32_t n, const char *digits) {
+    do {
+        *--end = digits[n & 0xf];
+        n >>= 4;
+    } while (n);
+    return end;
+}
+
+/*
+    supports %[-0][width][.precision][l]<d|i|u|x|X|p|s|c|%>, width and precision can be *
+    returns the number of chars produced
+*/
+static int format(struct fmt_out *out, const char *fmt, va_list v_args) {
     while (*fmt) {
-        if (*fmt == '%') {
+        /* copy the literal run up to the next conversion in one go */
+        const char *lit = fmt;
+        while (*fmt && *fmt != '%') {
             fmt++;
-            switch (*fmt) {
-            case '\0': {
-                putchar('\0');
-                fmt--; /* edge case */
+        }
+        out_str(out, lit, fmt - lit);
+
+        if (!*fmt) break;
+        fmt++; /* skip the % */
+
+        bool left = false, zero = false;
+        for (;; fmt++) {
+            if (*fmt == '-') {
+                left = true;
+            } else if (*fmt == '0') {
+                zero = true;
+            } else {
                 break;
             }
-            case '%': {
-                putchar('%');
-                break;
+        }
+
+        int width = 0;
+        if (*fmt == '*') {
+            width = va_arg(v_args, int);
+            if (width < 0) {
+                left = true;
+                width = -width;
+            }
+            fmt++;
+        } else {
+            while (*fmt >= '0' && *fmt <= '9') {
+                width = width * 10 + (*fmt++ - '0');
             }
+        }
 
-            case 's': {
-                const char *s = va_arg(v_args, const char *);
-                while (*s) {
-                    putchar(*s);
-                    s++;
+        int precision = -1;
+        if (*fmt == '.') {
+            fmt++;
+            precision = 0;
+            if (*fmt == '*') {
+                precision = va_arg(v_args, int);
+                fmt++;
+            } else {
+                while (*fmt >= '0' && *fmt <= '9') {
+                    precision = precision * 10 + (*fmt++ - '0');
                 }
-                break;
             }
+        }
 
-            case 'd': {
-                int val = va_arg(v_args, int);
-                /* binary to decimal conversion */
-
-                char out[11]; /* 32bit signed int holds 10 chars max + 1 char for null term */
-                int abs_val;
-                if (val >= 0) {
-                    abs_val = val;
-                } else {
-                    abs_val = -val;
-                    putchar('-');
-                }
+        /* long is 32bit here, nothing to do */
+        while (*fmt == 'l') {
+            fmt++;
+        }
 
-                int i = 0;
-                do {
-                    out[i++] = '0' + abs_val % 10; /* digit to char */
-                    abs_val /= 10;
-                } while (abs_val > 0);
+        char tmp[12]; /* 10 decimal digits of a 32bit int or "0x" + 8 hex digits */
+        char *end = tmp + sizeof(tmp);
+        const char *digits = end;
+        const char *prefix = "";
+        uint32_t val;
 
-                for (i -= 1; i >= 0; i--) {
-                    putchar(out[i]);
-                }
-                break;
-            }
-            case 'x': {
-                /* binary to hex conversion */
-                const char *hex_table = "0123456789abcdef";
-                int val = va_arg(v_args, int);
-                for (int i = 7; i >= 0; i--) {
-                    int blob = (val >> (4 * i)) & 0xf;
-                    putchar(hex_table[blob]);
-                }
-                break;
-            }
-            }
-        } else {
-            putchar(*fmt);
+        switch (*fmt) {
+        case '\0':
+            return out->total;
+        case 'c': {
+            char c = va_arg(v_args, int);
+            if (!left) out_pad(out, ' ', width - 1);
+            out_char(out, c);
+            if (left) out_pad(out, ' ', width - 1);
+            fmt++;
+            continue;
         }
+        case 's': {
+            const char *s = va_arg(v_args, const char *);
+            if (!s) s = "(null)";
 
+            int n = 0;
+            while (s[n] && (precision < 0 || n < precision)) {
+                n++;
+            }
+
+            if (!left) out_pad(out, ' ', width - n);
+            out_str(out, s, n);
+            if (left) out_pad(out, ' ', width - n);
+            fmt++;
+            continue;
+        }
+        case 'd':
+        case 'i': {
+            int v = va_arg(v_args, int);
+            /* negate in unsigned so INT_MIN doesn't overflow */
+            val = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+            if (v < 0) prefix = "-";
+            digits = utoa_dec(end, val);
+            break;
+        }
+        case 'u':
+            val = va_arg(v_args, uint32_t);
+            digits = utoa_dec(end, val);
+            break;
+        case 'x':
+            val = va_arg(v_args, uint32_t);
+            digits = utoa_hex(end, val, "0123456789abcdef");
+            break;
+        case 'X':
+            val = va_arg(v_args, uint32_t);
+            digits = utoa_hex(end, val, "0123456789ABCDEF");
+            break;
+        case 'p':
+            val = (uint32_t)va_arg(v_args, void *);
+            digits = utoa_hex(end, val, "0123456789abcdef");
+            prefix = "0x";
+            if (precision < 0) precision = 8;
+            break;
+        default:
+            /* %% and anything unknown is printed as is */
+            out_char(out, *fmt++);
+            continue;
+        }
         fmt++;
+
+        int n_digits = end - digits;
+        if (precision == 0 && val == 0) n_digits = 0; /* "%.0d" of 0 prints nothing */
+
+        int n_zeros = precision > n_digits ? precision - n_digits : 0;
+        int n_prefix = strlen(prefix);
+        int n_pad = width - n_prefix - n_zeros - n_digits;
+
+        /* the 0 flag pads between the sign and the digits, and is ignored with a precision */
+        if (zero && !left && precision < 0) {
+            n_zeros += n_pad;
+            n_pad = 0;
+        }
+
+        if (!left) out_pad(out, ' ', n_pad);
+        out_str(out, prefix, n_prefix);
+        out_pad(out, '0', n_zeros);
+        out_str(out, digits, n_digits);
+        if (left) out_pad(out, ' ', n_pad);
     }
+
+    return out->total;
+}
+
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list v_args) {
+    struct fmt_out out = {.buf = buf, .size = size ? size - 1 : 0, .flush = false};
+    format(&out, fmt, v_args);
+
+    if (size) buf[out.len] = '\0';
+    return out.total;
+}
+
+int snprintf(char *buf, size_t size, const char *fmt, ...) {
+    va_list v_args;
+    va_start(v_args, fmt);
+    int n = vsnprintf(buf, size, fmt, v_args);
+    va_end(v_args);
+    return n;
+}
+
+void printf(const char *fmt, ...) {
+    char buf[128];
+    struct fmt_out out = {.buf = buf, .size = sizeof(buf), .flush = true};
+
+    va_list v_args;
+    va_start(v_args, fmt);
+    format(&out, fmt, v_args);
+    va_end(v_args);
+
+    /* one console write per buffer instead of one per char */
+    if (out.len) console_write(out.buf, out.len);
 }
\ No newline at end of file
@@ -14,6 +14,9 @@ typedef uint32_t vaddr_t; /* virtual address */
 #define NULL ((void *)0) /* generic pointer that point to nothing */
 #define PAGE_SIZE 4096
 
+/* timer runs at 10MHz on the qemu virt machine */
+#define TIMEBASE_HZ 10000000
+
 /* use compilers default alignment functions  */
 #define align_up(value, align)                                                                                         \
     __builtin_align_up(value, align) /* rounds up value to the nearst multiple of align, align must be power of 2 */
@@ -30,9 +33,32 @@ typedef uint32_t vaddr_t; /* virtual address */
 void *memset(void *buf, char c, size_t n);
 void *memcpy(void *dst, const void *src, size_t n);
 char *strcpy(char *dst, const char *src);
+size_t strlen(const char *s);
 int strcmp(const char *s1, const char *s2);
 void printf(const char *fmt, ...);
+int snprintf(char *buf, size_t size, const char *fmt, ...);
+int vsnprintf(char *buf, size_t size, const char *fmt, va_list args);
 
 #define SYS_PUTCHAR 1
 #define SYS_GETCHAR 2
-#define SYS_EXIT 3
\ No newline at end of file
+#define SYS_EXIT 3
+#define SYS_PROF_START 4
+#define SYS_PROF_STOP 5
+#define SYS_PROF_DUMP 6
+#define SYS_GETPID 7
+#define SYS_YIELD 8
+#define SYS_SPAWN 9
+#define SYS_WAIT 10
+#define SYS_SBRK 11
+#define SYS_WRITE 12
+#define SYS_READDIR 13
+#define SYS_OPEN 14
+#define SYS_READ 15
+#define SYS_CLOSE 16
+
+#define FS_NAME_MAX 16 /* including the terminating null */
+
+struct dirent {
+    char name[FS_NAME_MAX];
+    uint32_t size;
+};
\ No newline at end of file
@@ -7,13 +7,26 @@ typedef uint32_t size_t;
 /* get the addresses declared in the kernel linker script, [] is used to avoid
  * getting the value */
 extern char __bss[], __bss_end[], __stack_top[], __free_ram_start[], __free_ram_end[], __kernel_base[];
-extern char _binary_shell_bin_start[], _binary_shell_bin_size[];
 
 struct process procs[PROCS_MAX];
 struct process *current_proc;
 struct process *idle_proc; /* dummy process to run when no processes are present */
-
-void yield(void);
+struct prof_buffer prof_buffers[HARTS_MAX];
+bool prof_enabled;
+char prof_progs[PROF_PROGS_MAX][FS_NAME_MAX]; /* programs sampled since prof_start */
+uint32_t prof_num_progs;
+
+bool yield(void);
+struct process *create_proces(const struct fs_entry *exe);
+paddr_t alloc_pages(uint32_t n);
+uint32_t free_pages(void);
+void map_page(uint32_t *table1, vaddr_t vaddr, paddr_t paddr, uint32_t flags);
+void plic_intr(void);
+struct buf *bread(uint32_t blockno);
+void brelse(struct buf *b);
+bool fs_lookup(const char *name, struct fs_entry *out);
+bool fs_entry_at(uint32_t index, struct fs_entry *out);
+size_t fs_read(const struct fs_entry *file, uint32_t offset, void *dst, size_t len);
 
 /*
     On RISC-V ISA the CPU can have the following privilege modes
@@ -62,6 +75,199 @@ long getchar(void) {
     return ret.err;
 }
 
+/* SBI debug console, one ecall per buffer instead of one per char, older firmware doesn't have it */
+void console_write(const char *buf, size_t len) {
+    static int has_dbcn = -1;
+    if (has_dbcn < 0) {
+        has_dbcn = sbi_call(SBI_EXT_DBCN, 0, 0, 0, 0, 0, 3 /* Probe Extension */, SBI_EXT_BASE).val != 0;
+    }
+
+    while (has_dbcn && len > 0) {
+        /* takes a physical address, fine since kernel memory is identity mapped */
+        struct sbi_ret ret = sbi_call(len, (uint32_t)buf, 0, 0, 0, 0, 0 /* Console Write */, SBI_EXT_DBCN);
+        if (ret.err) break;
+        buf += ret.val;
+        len -= ret.val;
+    }
+
+    for (size_t i = 0; i < len; i++) {
+        putchar(buf[i]);
+    }
+}
+
+/* legacy SBI timer, the 64bit deadline is split over a0 and a1 on rv32 */
+void sbi_set_timer(uint64_t deadline) { sbi_call(deadline, deadline >> 32, 0, 0, 0, 0, 0, 0 /* Set Timer */); }
+
+uint64_t read_time(void) {
+    /* the high half can tick over between the two reads, retry until it is stable */
+    uint32_t hi, lo;
+    do {
+        hi = READ_CSR(timeh);
+        lo = READ_CSR(time);
+    } while (hi != READ_CSR(timeh));
+
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* the kernel only runs on the boot hart for now */
+struct prof_buffer *prof_this_hart(void) { return &prof_buffers[0]; }
+
+void prof_arm_timer(void) { sbi_set_timer(read_time() + TIMEBASE_HZ / PROF_HZ); }
+
+void prof_start(void) {
+    struct prof_buffer *buf = prof_this_hart();
+    buf->count = 0;
+    buf->dropped = 0;
+    prof_num_progs = 0;
+    for (int i = 0; i < PROCS_MAX; i++) {
+        procs[i].prof_prog = -1;
+    }
+    prof_enabled = true;
+
+    prof_arm_timer();
+    WRITE_CSR(sie, READ_CSR(sie) | SIE_STIE);
+}
+
+void prof_stop(void) {
+    /* timer off before the flag, a tick in between would otherwise leave STIP pending forever */
+    WRITE_CSR(sie, READ_CSR(sie) & ~SIE_STIE);
+    sbi_set_timer(~0ull); /* push the deadline out so the pending tick is cleared */
+    prof_enabled = false;
+}
+
+/* index of the program proc runs in prof_progs, the name is only looked up on its first sample */
+uint8_t prof_prog(struct process *proc) {
+    if (proc->prof_prog >= 0) return proc->prof_prog;
+
+    for (uint32_t i = 0; i < prof_num_progs; i++) {
+        if (strcmp(prof_progs[i], proc->name) == 0) {
+            proc->prof_prog = i;
+            return i;
+        }
+    }
+
+    if (prof_num_progs == PROF_PROGS_MAX) return PROF_PROG_NONE;
+
+    memcpy(prof_progs[prof_num_progs], proc->name, FS_NAME_MAX);
+    proc->prof_prog = prof_num_progs++;
+    return proc->prof_prog;
+}
+
+/* called on every timer interrupt, records where the hart was when it fired */
+void prof_tick(uint32_t pc, bool from_user) {
+    struct prof_buffer *buf = prof_this_hart();
+
+    /* a late tick after prof_stop, clear it and don't record anything */
+    if (!prof_enabled) {
+        sbi_set_timer(~0ull);
+        return;
+    }
+
+    if (buf->count < PROF_SAMPLES_MAX) {
+        struct prof_sample *sample = &buf->samples[buf->count++];
+        sample->pc = pc;
+        sample->mode = from_user ? PROF_MODE_USER : PROF_MODE_KERNEL;
+        sample->pid = current_proc->pid;
+        sample->prog = prof_prog(current_proc);
+    } else {
+        buf->dropped++;
+    }
+
+    prof_arm_timer();
+}
+
+/*
+    one line per sample, prof.py on the host resolves the pcs against kernel.elf and the elf of the program named on
+    the line, the process may be long gone by now
+*/
+void prof_dump(void) {
+    prof_stop(); /* otherwise the dump ends up profiling itself */
+
+    for (int hart = 0; hart < HARTS_MAX; hart++) {
+        struct prof_buffer *buf = &prof_buffers[hart];
+        printf("PROF BEGIN %d %d %d %d\n", hart, PROF_HZ, buf->count, buf->dropped);
+        for (uint32_t i = 0; i < buf->count; i++) {
+            struct prof_sample *sample = &buf->samples[i];
+            const char *prog = sample->prog == PROF_PROG_NONE ? "?" : prof_progs[sample->prog];
+            printf("PROF %d %s %d %x %s\n", hart, sample->mode == PROF_MODE_USER ? "U" : "S", sample->pid, sample->pc,
+                   prog);
+        }
+        printf("PROF END %d\n", hart);
+    }
+}
+
+struct process *find_proc(int pid) {
+    if (pid <= 0 || pid > PROCS_MAX) return NULL;
+
+    struct process *proc = &procs[pid - 1];
+    /* the idle process sits in the first slot with pid 0 */
+    return proc->state == PROC_UNUSED || proc->pid != pid ? NULL : proc;
+}
+
+/* returns the pid, -1 if there is no program with that name or the process table is full */
+int spawn(const char *name) {
+    struct fs_entry exe;
+    if (!fs_lookup(name, &exe) || exe.mem_size == 0) return -1;
+
+    struct process *proc = create_proces(&exe);
+    return proc ? proc->pid : -1;
+}
+
+/*
+    true if [addr, addr + len) is mapped user memory of the current process, check every pointer a syscall gets,
+    write is for pointers the kernel stores into: the pinned pages at the start of the image are cache pages shared
+    with other processes and mapped read-only, a store there faults
+*/
+bool user_range_ok(vaddr_t addr, size_t len, bool write) {
+    vaddr_t end = addr + len;
+    if (end < addr) return false;
+
+    vaddr_t image_base = USER_BASE + (write ? current_proc->num_pinned * PAGE_SIZE : 0);
+    return (addr >= image_base && end <= current_proc->image_top) ||
+           (addr >= USER_HEAP_BASE && end <= current_proc->heap_top);
+}
+
+/* copies a null terminated string out of user memory, false if it is invalid or doesn't fit in size */
+bool copy_user_str(char *dst, vaddr_t src, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        if (!user_range_ok(src + i, 1, false)) return false;
+
+        dst[i] = *(const char *)(src + i);
+        if (dst[i] == '\0') return true;
+    }
+    return false;
+}
+
+/* frees the slot of an exited process, its memory still can't be */
+void reap(struct process *proc) {
+    for (int i = 0; i < proc->num_pinned; i++) {
+        brelse(proc->pinned[i]);
+    }
+    proc->num_pinned = 0;
+    proc->state = PROC_UNUSED;
+}
+
+struct open_file *find_file(int fd) {
+    if (fd < 0 || fd >= PROC_FILES_MAX || !current_proc->files[fd].used) return NULL;
+    return &current_proc->files[fd];
+}
+
+/* grows the heap of the current process by n zeroed pages, returns the old top, -1 if they don't fit */
+vaddr_t sbrk(uint32_t n) {
+    vaddr_t old_top = current_proc->heap_top;
+
+    /* map_page may also need a page table for every 4MB the heap grows into */
+    if (n > (USER_HEAP_END - old_top) / PAGE_SIZE || n + n / 1024 + 1 > free_pages()) return (vaddr_t)-1;
+
+    for (uint32_t i = 0; i < n; i++) {
+        map_page(current_proc->page_table, current_proc->heap_top, alloc_pages(1), PAGE_U | PAGE_R | PAGE_W);
+        current_proc->heap_top += PAGE_SIZE;
+    }
+
+    __asm__ __volatile__("sfence.vma"); /* the tlb may have cached the old invalid entries */
+    return old_top;
+}
+
 void handle_syscall(struct trap_frame *f) {
     switch (f->a3) {
     case SYS_PUTCHAR:
@@ -84,6 +290,119 @@ void handle_syscall(struct trap_frame *f) {
         yield();
         PANIC("Exited process is back from the dead");
         break;
+    case SYS_PROF_START:
+        prof_start();
+        break;
+    case SYS_PROF_STOP:
+        prof_stop();
+        break;
+    case SYS_PROF_DUMP:
+        prof_dump();
+        break;
+    case SYS_GETPID:
+        f->a0 = current_proc->pid;
+        break;
+    case SYS_YIELD:
+        yield();
+        break;
+    case SYS_SPAWN: {
+        /* copied out of user memory, user_entry sets SUM for this */
+        char name[FS_NAME_MAX];
+        f->a0 = copy_user_str(name, f->a0, sizeof(name)) ? spawn(name) : -1;
+        break;
+    }
+    case SYS_WAIT: {
+        struct process *proc = find_proc(f->a0);
+        if (!proc || proc == current_proc) {
+            f->a0 = -1;
+            break;
+        }
+
+        while (proc->state != PROC_EXITED) {
+            yield();
+        }
+        reap(proc);
+        f->a0 = 0;
+        break;
+    }
+    case SYS_SBRK:
+        f->a0 = sbrk(f->a0);
+        break;
+    case SYS_WRITE: {
+        /* user addresses mean nothing to the SBI, copy through a kernel buffer */
+        const char *src = (const char *)f->a0;
+        size_t len = f->a1;
+        if (!user_range_ok(f->a0, len, false)) {
+            f->a0 = -1;
+            break;
+        }
+
+        char chunk[128];
+        while (len > 0) {
+            size_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+            memcpy(chunk, src, n);
+            console_write(chunk, n);
+            src += n;
+            len -= n;
+        }
+        f->a0 = f->a1; /* bytes written */
+        break;
+    }
+    case SYS_READDIR: {
+        struct fs_entry entry;
+        if (!user_range_ok(f->a1, sizeof(struct dirent), true) || !fs_entry_at(f->a0, &entry)) {
+            f->a0 = -1;
+            break;
+        }
+
+        struct dirent *dirent = (struct dirent *)f->a1;
+        memcpy(dirent->name, entry.name, FS_NAME_MAX);
+        dirent->size = entry.size;
+        f->a0 = 0;
+        break;
+    }
+    case SYS_OPEN: {
+        char name[FS_NAME_MAX];
+        if (!copy_user_str(name, f->a0, sizeof(name))) {
+            f->a0 = -1;
+            break;
+        }
+
+        int fd = 0;
+        while (fd < PROC_FILES_MAX && current_proc->files[fd].used) {
+            fd++;
+        }
+
+        struct open_file *file = &current_proc->files[fd];
+        if (fd == PROC_FILES_MAX || !fs_lookup(name, &file->entry)) {
+            f->a0 = -1;
+            break;
+        }
+
+        file->used = true;
+        file->offset = 0;
+        f->a0 = fd;
+        break;
+    }
+    case SYS_READ: {
+        struct open_file *file = find_file(f->a0);
+        if (!file || !user_range_ok(f->a1, f->a2, true)) {
+            f->a0 = -1;
+            break;
+        }
+
+        /* straight from the cache into user memory */
+        size_t n = fs_read(&file->entry, file->offset, (void *)f->a1, f->a2);
+        file->offset += n;
+        f->a0 = n;
+        break;
+    }
+    case SYS_CLOSE: {
+        struct open_file *file = find_file(f->a0);
+        if (file) file->used = false;
+        f->a0 = file ? 0 : -1;
+        break;
+    }
     default:
         PANIC("unexpected systcall a3: %x\n", f->a3);
     }
@@ -95,15 +414,29 @@ void handle_trap(struct trap_frame *f) {
     /* stval - additional information (mem addr that caused the exception )*/
     uint32_t stval = READ_CSR(stval);
     uint32_t user_pc = READ_CSR(sepc);
-
-    if (scause == SCAUSE_ECALL) {
+    /* traps can now also come from the kernel itself (timer ticks during syscalls) */
+    bool from_user = (READ_CSR(sstatus) & SSTATUS_SPP) == 0;
+
+    if (scause == SCAUSE_S_TIMER) {
+        prof_tick(user_pc, from_user);
+    } else if (scause == SCAUSE_S_EXTERNAL) {
+        plic_intr();
+    } else if (scause == SCAUSE_ECALL) {
+        /* syscalls run with interrupts on so the profiler can sample the kernel too */
+        WRITE_CSR(sstatus, READ_CSR(sstatus) | SSTATUS_SIE);
         handle_syscall(f);
+        WRITE_CSR(sstatus, READ_CSR(sstatus) & ~SSTATUS_SIE);
         user_pc += 4; /* jump 4 to skip hte ecall and continue with exec */
     } else {
         PANIC("unexpected trap scause=%x, stval=%x, sepc=%x\n", scause, stval, user_pc);
     }
 
     WRITE_CSR(sepc, user_pc);
+
+    /* going back to user mode, the next trap needs to find the kernel stack of whoever is running now */
+    if (from_user) {
+        WRITE_CSR(sscratch, (uint32_t)&current_proc->stack[sizeof(current_proc->stack)]);
+    }
 }
 
 /* init core kernel functions */
@@ -111,9 +444,14 @@ __attribute__((naked)) __attribute__((aligned(4))) void kernel_entry(void) {
 
     /* saves the state of the registers on the stack but keeps stack poiter where it is, calls exeption handler,
      * restores registers back */
+    /* sscratch holds the kernel stack top while in user mode and 0 while in the kernel */
     __asm__ __volatile__(
         /* makig sp point to the kernel stack and sscratch hold the user stack sp */
         "csrrw sp, sscratch, sp\n"
+        "bnez sp, 1f\n"
+        /* trapped from the kernel, stay on the current stack */
+        "csrr sp, sscratch\n"
+        "1:\n"
 
         "addi sp, sp, -4 * 31\n"
         "sw ra,  4 * 0(sp)\n"
@@ -150,9 +488,8 @@ __attribute__((naked)) __attribute__((aligned(4))) void kernel_entry(void) {
         "csrr a0, sscratch\n"
         "sw a0, 4 * 30(sp)\n"
 
-        // reset the kernel stack
-        "addi a0, sp, 4 * 31\n"
-        "csrw sscratch, a0\n"
+        /* we are in the kernel now, handle_trap sets it back before returning to user mode */
+        "csrw sscratch, zero\n"
 
         "mv a0, sp\n"
         "call handle_trap\n"
@@ -191,9 +528,10 @@ __attribute__((naked)) __attribute__((aligned(4))) void kernel_entry(void) {
         "sret\n");
 }
 
+paddr_t next_paddr = (paddr_t)__free_ram_start;
+
 // /* linear allocator, mem can't be freed */
 paddr_t alloc_pages(uint32_t n) {
-    static paddr_t next_paddr = (paddr_t)__free_ram_start;
     paddr_t paddr = next_paddr;
     next_paddr += n * PAGE_SIZE;
 
@@ -203,6 +541,9 @@ paddr_t alloc_pages(uint32_t n) {
     return paddr;
 }
 
+/* pages alloc_pages can still hand out, check before allocating on behalf of a process */
+uint32_t free_pages(void) { return ((paddr_t)__free_ram_end - next_paddr) / PAGE_SIZE; }
+
 __attribute__((naked)) void switch_context(uint32_t *prev_sp, uint32_t *next_sp) {
     __asm__ __volatile__("addi sp, sp, -13 * 4\n"
                          "sw ra,  0  * 4(sp)\n" /* store word from ra into sp at offset */
@@ -286,14 +627,36 @@ void map_page(uint32_t *table1, vaddr_t vaddr, paddr_t paddr, uint32_t flags) {
 }
 
 __attribute__((naked)) void user_entry(void) {
-    __asm__ __volatile__("csrw sepc, %[sepc]        \n" /* program counter */
-                         "csrw sstatus, %[sstatus]  \n" /* hardware interrupts in user mode (won't be used) */
+    /* sstatus goes first, yield can get here with SIE on and an interrupt would clobber sepc and sscratch */
+    __asm__ __volatile__("csrw sstatus, %[sstatus]  \n" /* hardware interrupts in user mode (profiler ticks) */
+                         "csrw sepc, %[sepc]        \n" /* program counter */
+                         "csrw sscratch, sp         \n" /* switch_context left sp at the top of the kernel stack */
                          "sret                      \n"
                          :
-                         : [sepc] "r"(USER_BASE), [sstatus] "r"(SSTATUS_SPIE));
+                         : [sepc] "r"(USER_BASE), [sstatus] "r"(SSTATUS_SPIE | SSTATUS_SUM));
+}
+
+/*
+    maps a program at USER_BASE, the read-only pages are the block cache pages themselves so launching the same
+    program again neither reads nor copies them, writable pages get a private copy and the bss is fresh zeroed pages
+*/
+void load_program(struct process *proc, const struct fs_entry *exe) {
+    for (uint32_t off = 0; off < exe->mem_size; off += PAGE_SIZE) {
+        if (off < exe->ro_size && proc->num_pinned < PROC_PINNED_MAX) {
+            struct buf *b = bread(exe->start + off / BLOCK_SIZE);
+            proc->pinned[proc->num_pinned++] = b; /* stays in the cache until the process is reaped */
+            map_page(proc->page_table, USER_BASE + off, (paddr_t)b->data, PAGE_U | PAGE_R | PAGE_X);
+            continue;
+        }
+
+        paddr_t page = alloc_pages(1);
+        fs_read(exe, off, (void *)page, PAGE_SIZE);
+        map_page(proc->page_table, USER_BASE + off, page, PAGE_U | PAGE_R | PAGE_W | PAGE_X);
+    }
 }
 
-struct process *create_proces(const void *image, size_t image_size) {
+/* exe is NULL for the idle process, returns NULL if every slot is taken */
+struct process *create_proces(const struct fs_entry *exe) {
 
     struct process *proc = NULL;
 
@@ -306,8 +669,9 @@ struct process *create_proces(const void *image, size_t image_size) {
     }
 
     if (!proc) {
-        PANIC("no leftover processes");
+        return NULL;
     }
+    proc->state = PROC_LOADING; /* loading can wait on the disk and let another spawn look for a slot */
 
     uint32_t *sp = (uint32_t *)&(proc->stack[sizeof(proc->stack)]);
     for (int i = 0; i < 12; i++) {
@@ -321,25 +685,31 @@ struct process *create_proces(const void *image, size_t image_size) {
         map_page(page_table, paddr, paddr, PAGE_R | PAGE_W | PAGE_X);
     }
 
-    /* map user pages */
-    for (uint32_t off = 0; off < image_size; off += PAGE_SIZE) {
-        paddr_t page = alloc_pages(1);
-
-        size_t remaining = image_size - off;
-        size_t copy_size = PAGE_SIZE <= remaining ? PAGE_SIZE : remaining;
+    /* devices, interrupts can arrive while any process is running */
+    map_page(page_table, VIRTIO_BLK_PADDR, VIRTIO_BLK_PADDR, PAGE_R | PAGE_W);
+    map_page(page_table, PLIC_PADDR, PLIC_PADDR, PAGE_R | PAGE_W);
+    map_page(page_table, PLIC_SENABLE & ~(PAGE_SIZE - 1), PLIC_SENABLE & ~(PAGE_SIZE - 1), PAGE_R | PAGE_W);
+    map_page(page_table, PLIC_STHRESHOLD, PLIC_STHRESHOLD, PAGE_R | PAGE_W);
 
-        /* image is put in a page */
-        memcpy((void *)page, image + off, copy_size);
+    /* init proc struct, the slot may have been used by a process that exited */
+    proc->pid = i + 1;
+    proc->image_top = USER_BASE + (exe ? align_up(exe->mem_size, PAGE_SIZE) : 0);
+    proc->heap_top = USER_HEAP_BASE;
+    proc->num_pinned = 0;
+    proc->prof_prog = -1;
+    memset(proc->files, 0, sizeof(proc->files));
+    proc->sp = (vaddr_t)sp;
+    proc->page_table = page_table;
 
-        /* mapping is done from the app private addresses to the page */
-        map_page(page_table, USER_BASE + off, page, PAGE_U | PAGE_R | PAGE_W | PAGE_X);
+    /* map user pages */
+    if (exe) {
+        memcpy(proc->name, exe->name, FS_NAME_MAX);
+        load_program(proc, exe);
+    } else {
+        memcpy(proc->name, "idle", sizeof("idle"));
     }
 
-    /* init proc struct */
-    proc->pid = i + 1;
     proc->state = PROC_RUNNABLE;
-    proc->sp = (vaddr_t)sp;
-    proc->page_table = page_table;
     return proc;
 }
 
@@ -348,8 +718,8 @@ void delay(void) {
         __asm__ __volatile__("nop"); // do nothing
 }
 
-/* small scheduler */
-void yield(void) {
+/* small scheduler, returns false if there was nothing else to run */
+bool yield(void) {
     struct process *next_proc = idle_proc;
 
     /* tries to find the first process following the current pid that is runnable and is not the idle process */
@@ -363,29 +733,369 @@ void yield(void) {
 
     /* if found and it's the same as the current process, we keep going */
     if (next_proc == current_proc) {
-        return;
+        return false;
     }
 
     /* if it's not found then we switch to the idle process */
 
-    /* because we now use the proc stack, we confine them to their own exception */
+    /* sscratch is no longer touched here, handle_trap and user_entry point it at the right kernel stack */
     __asm__ __volatile__(
         "sfence.vma\n"         /* ensure all previous mem ops are completed */
         "csrw satp, %[satp]\n" /* satp holds the physical addr of the curr level 1 page table, we load the page table of
                                   the next process  */
         "sfence.vma\n"         /* flush the TLB */
-        "csrw sscratch, %[sscratch]\n" /* write the curr stack pointer to M registers for later use in contexts
-                                          switching */
         :
-        // Don't forget the trailing comma!
-        : [satp] "r"(SATP_SV32 | ((uint32_t)next_proc->page_table / PAGE_SIZE)), [sscratch] "r"(
-                                                                                     (uint32_t)&next_proc->stack[sizeof(
-                                                                                         next_proc->stack)]));
+        : [satp] "r"(SATP_SV32 | ((uint32_t)next_proc->page_table / PAGE_SIZE)));
 
     /* context switch */
     struct process *prev_proc = current_proc;
     current_proc = next_proc;
     switch_context(&prev_proc->sp, &next_proc->sp);
+    return true;
+}
+
+/* turns supervisor interrupts off, returns whether they were on */
+bool intr_off(void) {
+    uint32_t sstatus = READ_CSR(sstatus);
+    WRITE_CSR(sstatus, sstatus & ~SSTATUS_SIE);
+    return (sstatus & SSTATUS_SIE) != 0;
+}
+
+void intr_restore(bool on) {
+    if (on) WRITE_CSR(sstatus, READ_CSR(sstatus) | SSTATUS_SIE);
+}
+
+/* call with interrupts off after checking the condition, sleeps until an interrupt is pending and lets it run */
+void wait_for_interrupt(void) {
+    /* wfi also wakes up with SIE off, so an interrupt that came in after the check isn't missed */
+    __asm__ __volatile__("wfi" ::: "memory");
+    WRITE_CSR(sstatus, READ_CSR(sstatus) | SSTATUS_SIE);
+    WRITE_CSR(sstatus, READ_CSR(sstatus) & ~SSTATUS_SIE);
+}
+
+/*
+    call with interrupts off while waiting on the disk, runs the other processes in the meantime, returns with
+    interrupts off and false if nobody else could run, the caller then rechecks its condition and falls back to
+    wait_for_interrupt (always the case while booting, there are no processes yet)
+*/
+bool yield_for_disk(void) {
+    if (current_proc == idle_proc) return false;
+
+    /* on like in any other syscall, the completion may also come in right here */
+    WRITE_CSR(sstatus, READ_CSR(sstatus) | SSTATUS_SIE);
+    bool switched = yield();
+    WRITE_CSR(sstatus, READ_CSR(sstatus) & ~SSTATUS_SIE);
+    return switched;
+}
+
+struct virtio_virtq *blk_vq;
+struct blk_slot blk_slots[BLK_INFLIGHT_MAX];
+uint16_t blk_last_used_index;
+uint32_t blk_num_blocks;
+
+uint32_t virtio_reg_read32(unsigned offset) { return *((volatile uint32_t *)(VIRTIO_BLK_PADDR + offset)); }
+
+uint64_t virtio_reg_read64(unsigned offset) { return *((volatile uint64_t *)(VIRTIO_BLK_PADDR + offset)); }
+
+void virtio_reg_write32(unsigned offset, uint32_t value) {
+    *((volatile uint32_t *)(VIRTIO_BLK_PADDR + offset)) = value;
+}
+
+void virtio_reg_fetch_and_or32(unsigned offset, uint32_t value) {
+    virtio_reg_write32(offset, virtio_reg_read32(offset) | value);
+}
+
+void virtio_blk_init(void) {
+    if (virtio_reg_read32(VIRTIO_REG_MAGIC) != 0x74726976) PANIC("virtio: invalid magic value");
+    if (virtio_reg_read32(VIRTIO_REG_VERSION) != 1) PANIC("virtio: only the legacy interface is supported");
+    if (virtio_reg_read32(VIRTIO_REG_DEVICE_ID) != VIRTIO_DEVICE_BLK) PANIC("virtio: no disk attached");
+
+    /* reset, then tell the device we found it and know how to drive it */
+    virtio_reg_write32(VIRTIO_REG_DEVICE_STATUS, 0);
+    virtio_reg_fetch_and_or32(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACK);
+    virtio_reg_fetch_and_or32(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_DRIVER);
+    virtio_reg_write32(VIRTIO_REG_DRIVER_FEATURES, 0); /* no optional features */
+    virtio_reg_write32(VIRTIO_REG_GUEST_PAGE_SIZE, PAGE_SIZE);
+
+    /* a block device has a single request queue */
+    virtio_reg_write32(VIRTIO_REG_QUEUE_SEL, 0);
+    if (virtio_reg_read32(VIRTIO_REG_QUEUE_NUM_MAX) < VIRTQ_ENTRY_NUM) PANIC("virtio: queue too small");
+
+    blk_vq = (struct virtio_virtq *)alloc_pages(align_up(sizeof(struct virtio_virtq), PAGE_SIZE) / PAGE_SIZE);
+    virtio_reg_write32(VIRTIO_REG_QUEUE_NUM, VIRTQ_ENTRY_NUM);
+    virtio_reg_write32(VIRTIO_REG_QUEUE_ALIGN, PAGE_SIZE);
+    virtio_reg_write32(VIRTIO_REG_QUEUE_PFN, (uint32_t)blk_vq / PAGE_SIZE);
+
+    virtio_reg_fetch_and_or32(VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_DRIVER_OK);
+
+    /* the config space starts with the capacity in sectors */
+    blk_num_blocks = virtio_reg_read64(VIRTIO_REG_DEVICE_CONFIG) / SECTORS_PER_BLOCK;
+    printf("virtio-blk: %d blocks\n", blk_num_blocks);
+}
+
+int blk_free_slot(void) {
+    for (int i = 0; i < BLK_INFLIGHT_MAX; i++) {
+        if (!blk_slots[i].buf) return i;
+    }
+    return -1;
+}
+
+/*
+    queues a read of b and returns once the device has it, the interrupt clears BUF_BUSY when it is done, only waits
+    (running other processes meanwhile) when every request slot is in flight
+*/
+void virtio_blk_submit(struct buf *b) {
+    bool intr = intr_off();
+
+    /* busy right away, so other processes that find b while we wait for a slot don't submit it again */
+    b->flags |= BUF_BUSY;
+
+    int i;
+    while ((i = blk_free_slot()) < 0) {
+        if (!yield_for_disk() && blk_free_slot() < 0) wait_for_interrupt();
+    }
+
+    struct blk_slot *slot = &blk_slots[i];
+    slot->buf = b;
+    slot->req.type = VIRTIO_BLK_T_IN;
+    slot->req.reserved = 0;
+    slot->req.sector = (uint64_t)b->blockno * SECTORS_PER_BLOCK;
+    slot->req.status = 0xff;
+
+    /* addresses are physical, kernel memory is identity mapped */
+    struct virtq_desc *descs = &blk_vq->descs[i * 3];
+    descs[0].addr = (uint32_t)&slot->req;
+    descs[0].len = offsetof(struct virtio_blk_req, status);
+    descs[0].flags = VIRTQ_DESC_F_NEXT;
+    descs[0].next = i * 3 + 1;
+
+    descs[1].addr = (uint32_t)b->data;
+    descs[1].len = BLOCK_SIZE;
+    descs[1].flags = VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE; /* the device writes into the buffer */
+    descs[1].next = i * 3 + 2;
+
+    descs[2].addr = (uint32_t)&slot->req.status;
+    descs[2].len = sizeof(uint8_t);
+    descs[2].flags = VIRTQ_DESC_F_WRITE;
+
+    blk_vq->avail.ring[blk_vq->avail.index % VIRTQ_ENTRY_NUM] = i * 3;
+    __sync_synchronize(); /* the device must see the descriptors before the new index */
+    blk_vq->avail.index++;
+    __sync_synchronize();
+    virtio_reg_write32(VIRTIO_REG_QUEUE_NOTIFY, 0);
+
+    intr_restore(intr);
+}
+
+void virtio_blk_intr(void) {
+    /* ack first, anything that completes while we drain the ring raises a new interrupt */
+    virtio_reg_write32(VIRTIO_REG_INTERRUPT_ACK, virtio_reg_read32(VIRTIO_REG_INTERRUPT_STATUS));
+
+    volatile uint16_t *used_index = (uint16_t *)((uint8_t *)blk_vq + offsetof(struct virtio_virtq, used.index));
+    while (blk_last_used_index != *used_index) {
+        __sync_synchronize(); /* read the ring entry after the index */
+        struct virtq_used_elem *elem = &blk_vq->used.ring[blk_last_used_index % VIRTQ_ENTRY_NUM];
+        struct blk_slot *slot = &blk_slots[elem->id / 3];
+        struct buf *b = slot->buf;
+
+        if (slot->req.status != 0) {
+            PANIC("virtio: read of block %d failed, status=%d", b->blockno, slot->req.status);
+        }
+
+        b->flags = (b->flags | BUF_VALID) & ~BUF_BUSY;
+        slot->buf = NULL;
+        blk_last_used_index++;
+    }
+}
+
+void plic_init(void) {
+    *(volatile uint32_t *)PLIC_PRIORITY(VIRTIO_BLK_IRQ) = 1;
+    *(volatile uint32_t *)PLIC_SENABLE = 1 << VIRTIO_BLK_IRQ;
+    *(volatile uint32_t *)PLIC_STHRESHOLD = 0;
+    WRITE_CSR(sie, READ_CSR(sie) | SIE_SEIE);
+}
+
+void plic_intr(void) {
+    uint32_t irq = *(volatile uint32_t *)PLIC_SCLAIM;
+    if (irq == 0) return; /* someone else claimed it already */
+
+    if (irq == VIRTIO_BLK_IRQ) {
+        virtio_blk_intr();
+    } else {
+        PANIC("unexpected irq %d", irq);
+    }
+
+    *(volatile uint32_t *)PLIC_SCLAIM = irq; /* writing it back completes the interrupt */
+}
+
+struct buf bcache[NBUF];
+struct buf bcache_lru; /* list head, bcache_lru.next is the most recently used buffer */
+
+void lru_remove(struct buf *b) {
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+}
+
+void lru_push_front(struct buf *b) {
+    b->next = bcache_lru.next;
+    b->prev = &bcache_lru;
+    bcache_lru.next->prev = b;
+    bcache_lru.next = b;
+}
+
+void bcache_init(void) {
+    uint8_t *pages = (uint8_t *)alloc_pages(NBUF);
+
+    bcache_lru.prev = &bcache_lru;
+    bcache_lru.next = &bcache_lru;
+    for (int i = 0; i < NBUF; i++) {
+        struct buf *b = &bcache[i];
+        b->blockno = ~0u; /* holds no block */
+        b->data = pages + i * BLOCK_SIZE;
+        lru_push_front(b);
+    }
+}
+
+/*
+    blocks the calling process until b is off the disk, other processes run in the meantime, the hart only sleeps in
+    wfi when nobody else can run
+*/
+void blk_wait(struct buf *b) {
+    bool intr = intr_off();
+    while (b->flags & BUF_BUSY) {
+        if (!yield_for_disk() && (b->flags & BUF_BUSY)) wait_for_interrupt();
+    }
+    intr_restore(intr);
+}
+
+/*
+    the cache functions run with interrupts off, the disk interrupt changes buf flags under them otherwise, they can
+    still yield to other processes while waiting on the disk, so nothing found before a wait is trusted after it
+*/
+
+/* like bget, but NULL when every buffer is held or busy */
+struct buf *bget_try(uint32_t blockno) {
+    if (blockno >= blk_num_blocks) PANIC("block %d out of range", blockno);
+
+    for (struct buf *b = bcache_lru.next; b != &bcache_lru; b = b->next) {
+        if (b->blockno == blockno) {
+            b->refcnt++;
+            lru_remove(b);
+            lru_push_front(b);
+            return b;
+        }
+    }
+
+    /* recycle the least recently used buffer that nobody holds, blocks are never written so none is dirty */
+    for (struct buf *b = bcache_lru.prev; b != &bcache_lru; b = b->prev) {
+        if (b->refcnt > 0 || (b->flags & BUF_BUSY)) continue;
+
+        b->blockno = blockno;
+        b->flags = 0;
+        b->refcnt = 1;
+        lru_remove(b);
+        lru_push_front(b);
+        return b;
+    }
+
+    return NULL;
+}
+
+/* returns the buffer for blockno with a reference held, the data is only there once BUF_VALID is set */
+struct buf *bget(uint32_t blockno) {
+    struct buf *b = bget_try(blockno);
+    if (!b) PANIC("no free buffers");
+    return b;
+}
+
+void brelse(struct buf *b) {
+    bool intr = intr_off();
+    if (b->refcnt == 0) PANIC("brelse of unheld block %d", b->blockno);
+    b->refcnt--;
+    intr_restore(intr);
+}
+
+/* starts reads for the blocks after blockno, it is only a hint so it stops instead of waiting for a slot or a buffer */
+void bcache_readahead(uint32_t blockno) {
+    for (uint32_t n = blockno + 1; n <= blockno + BCACHE_READAHEAD && n < blk_num_blocks; n++) {
+        if (blk_free_slot() < 0) break;
+
+        struct buf *b = bget_try(n);
+        if (!b) break;
+
+        if (!(b->flags & (BUF_VALID | BUF_BUSY))) {
+            b->flags |= BUF_READAHEAD;
+            virtio_blk_submit(b); /* there is a free slot, so this doesn't wait */
+        }
+        brelse(b);
+    }
+}
+
+/* returns the block with its data, release it with brelse */
+struct buf *bread(uint32_t blockno) {
+    bool intr = intr_off();
+    struct buf *b = bget(blockno);
+
+    /* a miss or the first hit on a read-ahead block means a sequential reader, keep the window moving */
+    bool miss = !(b->flags & (BUF_VALID | BUF_BUSY));
+    bool ahead = b->flags & BUF_READAHEAD;
+    b->flags &= ~BUF_READAHEAD;
+
+    if (miss) virtio_blk_submit(b);
+    if (miss || ahead) bcache_readahead(blockno);
+
+    blk_wait(b);
+    intr_restore(intr);
+    return b;
+}
+
+void fs_init(void) {
+    struct buf *b = bread(0);
+    struct fs_super *super = (struct fs_super *)b->data;
+
+    if (super->magic != FS_MAGIC) PANIC("fs: bad magic %x, the disk wasn't made by mkfs.py", super->magic);
+    if (super->num_entries > FS_ENTRIES_MAX) PANIC("fs: index has %d entries", super->num_entries);
+
+    printf("fs: %d files\n", super->num_entries);
+    brelse(b);
+}
+
+/* copies the index entry out so the caller doesn't hold on to block 0 */
+bool fs_entry_at(uint32_t index, struct fs_entry *out) {
+    struct buf *b = bread(0);
+    struct fs_super *super = (struct fs_super *)b->data;
+
+    bool found = index < super->num_entries;
+    if (found) *out = super->entries[index];
+
+    brelse(b);
+    return found;
+}
+
+bool fs_lookup(const char *name, struct fs_entry *out) {
+    for (uint32_t i = 0; fs_entry_at(i, out); i++) {
+        if (strcmp(out->name, name) == 0) return true;
+    }
+    return false;
+}
+
+/* copies up to len bytes of the file at offset through the block cache, returns how many */
+size_t fs_read(const struct fs_entry *file, uint32_t offset, void *dst, size_t len) {
+    if (offset >= file->size) return 0;
+    if (len > file->size - offset) len = file->size - offset;
+
+    for (size_t done = 0; done < len;) {
+        uint32_t pos = offset + done;
+        size_t block_off = pos % BLOCK_SIZE;
+        size_t n = BLOCK_SIZE - block_off < len - done ? BLOCK_SIZE - block_off : len - done;
+
+        struct buf *b = bread(file->start + pos / BLOCK_SIZE);
+        memcpy((uint8_t *)dst + done, b->data + block_off, n);
+        brelse(b);
+        done += n;
+    }
+
+    return len;
 }
 
 // struct process *proc_a;
@@ -414,13 +1124,20 @@ void kernel_main(void) {
 
     /* stvec - supervisor trap vector base address register, holds the address of the kernel trap handler function */
     WRITE_CSR(stvec, (uint32_t)kernel_entry);
+    WRITE_CSR(sscratch, 0); /* running in the kernel */
+    WRITE_CSR(scounteren, SCOUNTEREN_TM); /* lets user programs time themselves with rdtime */
+
+    plic_init();
+    virtio_blk_init();
+    bcache_init();
+    fs_init();
 
     /* default idle process */
-    idle_proc = create_proces(NULL, 0);
+    idle_proc = create_proces(NULL);
     idle_proc->pid = 0;
     current_proc = idle_proc;
 
-    create_proces(_binary_shell_bin_start, (size_t)_binary_shell_bin_size);
+    if (spawn("shell") < 0) PANIC("no shell on the disk");
 
     yield();
 
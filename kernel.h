@@ -6,6 +6,9 @@ struct sbi_ret {
     long val;
 };
 
+#define SBI_EXT_BASE 0x10
+#define SBI_EXT_DBCN 0x4442434e /* debug console */
+
 /* encloded in a dead do-while loop for scope purposes */
 /* the second while loop halts everything */
 #define PANIC(fmt, ...)                                                                                                \
@@ -63,14 +66,52 @@ struct trap_frame {
         __asm__ __volatile__("csrw " #reg ", %0" ::"r"(__tmp));                                                        \
     } while (0)
 
+/*
+    read-only filesystem, block 0 holds the index and every file starts on a block of its own so that pages of a
+    program can be mapped straight out of the block cache, mkfs.py builds the image
+*/
+#define FS_MAGIC 0x53465954 /* "TYFS" */
+
+struct fs_entry {
+    char name[FS_NAME_MAX];
+    uint32_t start;    /* first block */
+    uint32_t size;     /* bytes on disk */
+    uint32_t ro_size;  /* leading bytes of a program that are never written (text, rodata), page aligned */
+    uint32_t mem_size; /* bytes a program takes in memory with its bss, 0 for plain files */
+} __attribute__((packed));
+
+struct fs_super {
+    uint32_t magic;
+    uint32_t num_entries;
+    struct fs_entry entries[];
+} __attribute__((packed));
+
+struct open_file {
+    bool used;
+    uint32_t offset;
+    struct fs_entry entry;
+};
+
 #define PROCS_MAX 8 /* max num of processes */
 #define PROC_UNUSED 0
 #define PROC_RUNNABLE 1
 #define PROC_EXITED 2
+#define PROC_LOADING 3 /* slot taken, program still being read from the disk */
+
+#define PROC_FILES_MAX 4
+#define PROC_PINNED_MAX 4 /* cache pages a process may map shared, keeps most of the cache free for everyone else */
 
 struct process {
     int pid;
-    int state;  /* unused or rumnnable */
+    int state;              /* unused or rumnnable */
+    char name[FS_NAME_MAX]; /* program the process was created from */
+    vaddr_t image_top;      /* end of the program mapped at USER_BASE */
+    vaddr_t heap_top;       /* end of the memory handed out by sbrk */
+    /* cache pages mapped into the process, held until it is reaped */
+    struct buf *pinned[PROC_PINNED_MAX];
+    int num_pinned;
+    int prof_prog; /* index into prof_progs, -1 until the process is first sampled after prof_start */
+    struct open_file files[PROC_FILES_MAX];
     vaddr_t sp; /* stack pointer */
     uint32_t *page_table;
     uint8_t stack[8192]; /* kernel stack */
@@ -85,7 +126,149 @@ struct process {
 
 /* base addres of app */
 #define USER_BASE 0x1000000
+/* sbrk hands out pages from here, user.ld keeps images below it */
+#define USER_HEAP_BASE 0x1800000
+/* and up to here, the devices are mapped from PLIC_PADDR on */
+#define USER_HEAP_END 0x0c000000
+
+#define SSTATUS_SIE (1 << 1)  /* supervisor interrupts enabled */
+#define SSTATUS_SPIE (1 << 5) /* interrupts enabled before the trap */
+#define SSTATUS_SPP (1 << 8)  /* privilege before the trap, 0 = user, 1 = supervisor */
+#define SSTATUS_SUM (1 << 18) /* kernel may access user pages */
 
-#define SSTATUS_SPIE (1 << 5)
+#define SCOUNTEREN_TM (1 << 1) /* user mode may read the time csr */
+
+#define SIE_STIE (1 << 5) /* supervisor timer interrupt enable */
+#define SIE_SEIE (1 << 9) /* supervisor external interrupt enable */
+
+#define SCAUSE_INTERRUPT (1u << 31)
+#define SCAUSE_ECALL 8
+#define SCAUSE_S_TIMER (SCAUSE_INTERRUPT | 5)
+#define SCAUSE_S_EXTERNAL (SCAUSE_INTERRUPT | 9)
+
+/* sampling profiler */
+#define HARTS_MAX 1 /* only the boot hart is brought up */
+#define PROF_HZ 1000
+#define PROF_SAMPLES_MAX 4096
+#define PROF_MODE_USER 0
+#define PROF_MODE_KERNEL 1
+#define PROF_PROGS_MAX 16   /* distinct programs named in one profile */
+#define PROF_PROG_NONE 0xff /* sampled after prof_progs filled up */
+
+/* PLIC, routes device interrupts to the harts, the supervisor context of hart 0 is context 1 */
+#define PLIC_PADDR 0x0c000000
+#define PLIC_PRIORITY(irq) (PLIC_PADDR + 4 * (irq))
+#define PLIC_SENABLE (PLIC_PADDR + 0x2080)
+#define PLIC_STHRESHOLD (PLIC_PADDR + 0x201000)
+#define PLIC_SCLAIM (PLIC_PADDR + 0x201004)
+
+/* virtio-blk over the legacy virtio-mmio interface of the qemu virt machine */
+#define SECTOR_SIZE 512
+#define VIRTQ_ENTRY_NUM 32
+#define VIRTIO_DEVICE_BLK 2
+#define VIRTIO_BLK_PADDR 0x10001000
+#define VIRTIO_BLK_IRQ 1
+#define VIRTIO_REG_MAGIC 0x00
+#define VIRTIO_REG_VERSION 0x04
+#define VIRTIO_REG_DEVICE_ID 0x08
+#define VIRTIO_REG_DRIVER_FEATURES 0x20
+#define VIRTIO_REG_GUEST_PAGE_SIZE 0x28
+#define VIRTIO_REG_QUEUE_SEL 0x30
+#define VIRTIO_REG_QUEUE_NUM_MAX 0x34
+#define VIRTIO_REG_QUEUE_NUM 0x38
+#define VIRTIO_REG_QUEUE_ALIGN 0x3c
+#define VIRTIO_REG_QUEUE_PFN 0x40
+#define VIRTIO_REG_QUEUE_NOTIFY 0x50
+#define VIRTIO_REG_INTERRUPT_STATUS 0x60
+#define VIRTIO_REG_INTERRUPT_ACK 0x64
+#define VIRTIO_REG_DEVICE_STATUS 0x70
+#define VIRTIO_REG_DEVICE_CONFIG 0x100
+#define VIRTIO_STATUS_ACK 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2 /* device writes into the buffer */
+#define VIRTIO_BLK_T_IN 0 /* read, nothing writes to the disk yet */
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct virtq_avail {
+    uint16_t flags;
+    uint16_t index;
+    uint16_t ring[VIRTQ_ENTRY_NUM];
+} __attribute__((packed));
+
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+} __attribute__((packed));
+
+struct virtq_used {
+    uint16_t flags;
+    uint16_t index;
+    struct virtq_used_elem ring[VIRTQ_ENTRY_NUM];
+} __attribute__((packed));
+
+/* layout the legacy interface expects, the used ring starts on the next page */
+struct virtio_virtq {
+    struct virtq_desc descs[VIRTQ_ENTRY_NUM];
+    struct virtq_avail avail;
+    struct virtq_used used __attribute__((aligned(PAGE_SIZE)));
+} __attribute__((packed));
+
+/* header the device reads, then the data, then the status byte the device writes */
+struct virtio_blk_req {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+    uint8_t status;
+} __attribute__((packed));
+
+/* every request takes three descriptors, slot i owns descriptors 3i to 3i+2 */
+#define BLK_INFLIGHT_MAX (VIRTQ_ENTRY_NUM / 3)
+
+struct blk_slot {
+    struct virtio_blk_req req;
+    struct buf *buf; /* NULL when the slot is free */
+};
+
+/* block cache, a block is one page so cached blocks can be mapped straight into processes */
+#define BLOCK_SIZE PAGE_SIZE
+#define SECTORS_PER_BLOCK (BLOCK_SIZE / SECTOR_SIZE)
+#define NBUF 64
+#define BCACHE_READAHEAD 4 /* blocks fetched ahead of a sequential reader */
+
+#define BUF_VALID (1 << 0)     /* data holds the block */
+#define BUF_BUSY (1 << 1)      /* request in flight */
+#define BUF_READAHEAD (1 << 2) /* fetched ahead, not read by anyone yet */
+
+struct buf {
+    uint32_t blockno;
+    volatile uint32_t flags; /* changed by the disk interrupt */
+    uint32_t refcnt;
+    struct buf *prev; /* lru list, most recently used first */
+    struct buf *next;
+    uint8_t *data;
+};
+
+/* the fs index has to fit in block 0 */
+#define FS_ENTRIES_MAX ((BLOCK_SIZE - sizeof(struct fs_super)) / sizeof(struct fs_entry))
+
+struct prof_sample {
+    uint32_t pc;  /* sepc at the tick */
+    uint8_t mode; /* user or kernel */
+    uint8_t pid;  /* process that was running */
+    uint8_t prog; /* index into prof_progs, pids get reused so they alone don't say which program it was */
+};
 
-#define SCAUSE_ECALL 8
\ No newline at end of file
+/* samples are kept per hart so ticks never contend on the same buffer */
+struct prof_buffer {
+    struct prof_sample samples[PROF_SAMPLES_MAX];
+    uint32_t count;
+    uint32_t dropped; /* ticks that arrived with a full buffer */
+};
\ No newline at end of file
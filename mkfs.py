@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""
+Builds the read-only disk image the kernel loads programs from.
+
+    ./mkfs.py disk.img shell.elf bench.elf README.md
+
+Block 0 holds the index (see struct fs_super in kernel.h), every file starts on a block of its own. ELF files are
+stored as the flat image the kernel maps at USER_BASE, named without the .elf, with the size of their read-only part
+so the kernel can map those pages shared. Anything else is stored as is.
+"""
+
+import argparse
+import os
+import struct
+import sys
+
+BLOCK_SIZE = 4096
+FS_MAGIC = 0x53465954
+FS_NAME_MAX = 16
+ENTRY = struct.Struct("<%dsIIII" % FS_NAME_MAX)  # name, start, size, ro_size, mem_size
+SUPER = struct.Struct("<II")  # magic, num_entries
+
+PT_LOAD = 1
+PF_W = 2
+
+
+def load_elf(path):
+    """returns (flat image, read-only bytes, bytes in memory) of a statically linked elf32"""
+    with open(path, "rb") as f:
+        elf = f.read()
+
+    if elf[:4] != b"\x7fELF" or elf[4] != 1:
+        sys.exit("%s: not an elf32 file" % path)
+
+    phoff, = struct.unpack_from("<I", elf, 28)
+    phentsize, phnum = struct.unpack_from("<HH", elf, 42)
+
+    segments = []
+    for i in range(phnum):
+        p_type, offset, vaddr, _, filesz, memsz, flags, _ = struct.unpack_from("<8I", elf, phoff + i * phentsize)
+        if p_type == PT_LOAD and memsz > 0:
+            segments.append((vaddr, offset, filesz, memsz, flags))
+
+    base = min(vaddr for vaddr, *_ in segments)
+    image = bytearray(max(vaddr + filesz for vaddr, _, filesz, _, _ in segments) - base)
+    for vaddr, offset, filesz, _, _ in segments:
+        image[vaddr - base : vaddr - base + filesz] = elf[offset : offset + filesz]
+
+    mem_size = max(vaddr + memsz for vaddr, _, _, memsz, _ in segments) - base
+
+    # everything up to the page holding the first writable byte can be shared
+    writable = [vaddr - base for vaddr, _, _, _, flags in segments if flags & PF_W]
+    ro_size = min(writable + [len(image)]) // BLOCK_SIZE * BLOCK_SIZE
+
+    return bytes(image), ro_size, mem_size
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("image")
+    parser.add_argument("files", nargs="+")
+    args = parser.parse_args()
+
+    max_entries = (BLOCK_SIZE - SUPER.size) // ENTRY.size
+    if len(args.files) > max_entries:
+        sys.exit("at most %d files fit in the index" % max_entries)
+
+    index = []
+    blocks = []
+    next_block = 1
+    for path in args.files:
+        name = os.path.basename(path)
+        if name.endswith(".elf"):
+            name = name[: -len(".elf")]
+            data, ro_size, mem_size = load_elf(path)
+        else:
+            with open(path, "rb") as f:
+                data = f.read()
+            ro_size, mem_size = 0, 0
+
+        if len(name.encode()) >= FS_NAME_MAX:
+            sys.exit("%s: name longer than %d chars" % (name, FS_NAME_MAX - 1))
+
+        index.append(ENTRY.pack(name.encode(), next_block, len(data), ro_size, mem_size))
+        padded = data + bytes(-len(data) % BLOCK_SIZE)
+        blocks.append(padded)
+        next_block += len(padded) // BLOCK_SIZE
+
+    header = SUPER.pack(FS_MAGIC, len(index)) + b"".join(index)
+    with open(args.image, "wb") as f:
+        f.write(header + bytes(BLOCK_SIZE - len(header)))
+        for data in blocks:
+            f.write(data)
+
+
+if __name__ == "__main__":
+    main()
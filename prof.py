@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""
+Turns the samples printed by the shell's `prof dump` command into a flat profile and folded stacks.
+
+    ./run.sh | tee console.log     (then "prof start", do stuff, "prof dump")
+    ./prof.py console.log --folded prof.folded
+    flamegraph.pl prof.folded > prof.svg
+
+Kernel samples are resolved against kernel.elf and user samples against the elf of the program named on each sample
+line (<name>.elf) with llvm-symbolizer, inlined frames included, so the folded stacks show the inline chain under each
+sampled function.
+"""
+
+import argparse
+import collections
+import os
+import subprocess
+import sys
+
+
+def parse_dump(lines):
+    """returns [(hart, mode, pid, pc, program), ...] from the console log, program is "?" if the kernel lost track"""
+    samples = []
+    for line in lines:
+        fields = line.strip().split()
+        if len(fields) == 6 and fields[0] == "PROF" and fields[1] not in ("BEGIN", "END"):
+            hart, mode, pid, pc, program = fields[1:]
+            samples.append((int(hart), mode, int(pid), int(pc, 16), program))
+    return samples
+
+
+def symbolize(symbolizer, elf, pcs):
+    """returns {pc: [(function, location), ...]} with the innermost frame first"""
+    pcs = sorted(pcs)
+    if not pcs:
+        return {}
+
+    out = subprocess.run(
+        [symbolizer, "--obj=" + elf, "--inlining", "--functions=linkage", "--demangle"],
+        input="\n".join("0x%x" % pc for pc in pcs) + "\n",
+        capture_output=True,
+        text=True,
+        check=True,
+    ).stdout
+
+    # one block of "function\nfile:line:col" pairs per address, blocks separated by a blank line
+    result = {}
+    blocks = out.strip("\n").split("\n\n")
+    for pc, block in zip(pcs, blocks):
+        rows = block.split("\n")
+        frames = []
+        for i in range(0, len(rows) - 1, 2):
+            function, location = rows[i], rows[i + 1]
+            if function == "??":
+                function = "0x%x" % pc
+            frames.append((function, os.path.basename(location)))
+        result[pc] = frames or [("0x%x" % pc, "??")]
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("log", nargs="?", help="console log containing a prof dump (default: stdin)")
+    parser.add_argument("--kernel", default="kernel.elf", help="elf used for kernel mode samples")
+    parser.add_argument("--user", default="shell.elf", help="elf used for user samples without a program name")
+    parser.add_argument("--symbolizer", default=os.environ.get("SYMBOLIZER", "llvm-symbolizer"))
+    parser.add_argument("--folded", help="write folded stacks for flamegraph.pl to this file")
+    parser.add_argument("--top", type=int, default=30, help="rows in the flat profile")
+    args = parser.parse_args()
+
+    with open(args.log) if args.log else sys.stdin as f:
+        samples = parse_dump(f)
+
+    if not samples:
+        sys.exit("no PROF samples found, did you run `prof dump`?")
+
+    # every user program is linked at the same address, so the elf depends on the program
+    def elf_for(mode, program):
+        if mode == "S":
+            return args.kernel
+        if program != "?":
+            return os.path.join(os.path.dirname(args.kernel), program + ".elf")
+        return args.user
+
+    unnamed = sum(1 for _, mode, _, _, program in samples if mode == "U" and program == "?")
+    if unnamed:
+        print("warning: %d user samples without a program, resolved against %s" % (unnamed, args.user), file=sys.stderr)
+
+    pcs = collections.defaultdict(set)
+    for _, mode, _, pc, program in samples:
+        pcs[elf_for(mode, program)].add(pc)
+    symbols = {elf: symbolize(args.symbolizer, elf, pcs[elf]) for elf in pcs}
+
+    flat = collections.Counter()
+    folded = collections.Counter()
+    modes = collections.Counter()
+    for _, mode, pid, pc, program in samples:
+        frames = symbols[elf_for(mode, program)][pc]
+        function = frames[0][0]
+        flat[(mode, function)] += 1
+        modes[mode] += 1
+
+        root = "kernel" if mode == "S" else "user"
+        stack = [root, "pid %d %s" % (pid, program)] + [function for function, _ in reversed(frames)]
+        folded[";".join(stack)] += 1
+
+    total = len(samples)
+    print("%d samples, %d kernel, %d user" % (total, modes["S"], modes["U"]))
+    print()
+    print("%8s %7s  %-4s %s" % ("samples", "%", "mode", "function"))
+    for (mode, function), count in flat.most_common(args.top):
+        print("%8d %6.2f%%  %-4s %s" % (count, 100.0 * count / total, mode, function))
+
+    if args.folded:
+        with open(args.folded, "w") as f:
+            for stack, count in sorted(folded.items()):
+                f.write("%s %d\n" % (stack, count))
+
+
+if __name__ == "__main__":
+    main()
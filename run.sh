@@ -1,22 +1,38 @@
 #!/bin/bash
 set -xue
 
-QEMU=qemu-system-riscv32
-OBJCOPY=/opt/homebrew/opt/llvm/bin/llvm-objcopy
+QEMU=${QEMU:-qemu-system-riscv32}
+
+# llvm from homebrew on macOS, whatever is on the PATH elsewhere (Ubuntu: apt install clang lld llvm)
+LLVM_BIN=${LLVM_BIN:-}
+if [ -z "$LLVM_BIN" ] && [ -d /opt/homebrew/opt/llvm/bin ]; then
+    LLVM_BIN=/opt/homebrew/opt/llvm/bin
+fi
 
 # Path to clang and compiler flags
-CC=/opt/homebrew/opt/llvm/bin/clang  # Ubuntu users: use CC=clang
+CC=${LLVM_BIN:+$LLVM_BIN/}clang
 CFLAGS="-std=c11 -O2 -g3 -Wall -Wextra --target=riscv32-unknown-elf -fuse-ld=lld -fno-stack-protector -ffreestanding -nostdlib"
 
-# Build the shell (application)
-$CC $CFLAGS -Wl,-Tuser.ld -Wl,-Map=shell.map -o shell.elf shell.c user.c common.c
-$OBJCOPY --set-section-flags .bss=alloc,contents -O binary shell.elf shell.bin
-$OBJCOPY -Ibinary -Oelf32-littleriscv shell.bin shell.bin.o
+# Build a user program, it ends up on the disk image
+build_app() {
+    local name=$1
+    $CC $CFLAGS -Wl,-Tuser.ld -Wl,-Map=$name.map -o $name.elf $name.c user.c common.c
+}
+
+# Build the applications
+build_app shell
+build_app bench
 
 # Build the kernel
 $CC $CFLAGS -Wl,-Tkernel.ld -Wl,-Map=kernel.map -o kernel.elf \
-    kernel.c common.c shell.bin.o
+    kernel.c common.c
+
+# Build the disk the programs are loaded from
+python3 mkfs.py disk.img shell.elf bench.elf README.md
 
-# Start QEMU
-$QEMU -machine virt -bios default -nographic -serial mon:stdio --no-reboot \
-    -kernel kernel.elf
\ No newline at end of file
+# Start QEMU, exec so that bench.py can drive and kill it directly
+exec $QEMU -machine virt -bios default -nographic -serial mon:stdio --no-reboot \
+    -global virtio-mmio.force-legacy=true \
+    -drive id=drive0,file=disk.img,format=raw,if=none \
+    -device virtio-blk-device,drive=drive0,bus=virtio-mmio-bus.0 \
+    -kernel kernel.elf
@@ -1,5 +1,44 @@
 #include "user.h"
 
+/* returns what follows prefix in cmdline, NULL if cmdline doesn't start with it */
+const char *arg_after(const char *cmdline, const char *prefix) {
+    while (*prefix) {
+        if (*cmdline++ != *prefix++) return NULL;
+    }
+    return cmdline;
+}
+
+void ls(void) {
+    struct dirent dirent;
+    for (int i = 0; readdir(i, &dirent) == 0; i++) {
+        printf("%-16s %u\n", dirent.name, dirent.size);
+    }
+}
+
+void cat(const char *name) {
+    int fd = open(name);
+    if (fd < 0) {
+        printf("no such file %s\n", name);
+        return;
+    }
+
+    char buf[512];
+    int n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        console_write(buf, n);
+    }
+    close(fd);
+}
+
+/* runs a program from the disk and waits for it, false if there is no such program */
+bool run(const char *name) {
+    int pid = spawn(name);
+    if (pid < 0) return false;
+
+    wait(pid);
+    return true;
+}
+
 void main(void) {
 
     /* page fault beacuse that address is not user mode accesible */
@@ -30,11 +69,25 @@ void main(void) {
             }
         }
 
+        const char *arg;
         if (strcmp(cmdline, "hello") == 0) {
             printf("hello to you\n");
         } else if (strcmp(cmdline, "exit") == 0) {
             exit();
-        } else {
+        } else if (strcmp(cmdline, "ls") == 0) {
+            ls();
+        } else if ((arg = arg_after(cmdline, "cat "))) {
+            cat(arg);
+        } else if ((arg = arg_after(cmdline, "run "))) {
+            if (!run(arg)) printf("no such program %s\n", arg);
+        } else if (strcmp(cmdline, "prof start") == 0) {
+            prof_start();
+        } else if (strcmp(cmdline, "prof stop") == 0) {
+            prof_stop();
+        } else if (strcmp(cmdline, "prof dump") == 0) {
+            prof_dump();
+        } else if (!run(cmdline)) {
+            /* anything else is taken as the name of a program */
             printf("unknown command %s\n", cmdline);
         }
     }
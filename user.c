@@ -22,8 +22,41 @@ __attribute__((noreturn)) void exit(void) {
 
 void putchar(char c) { syscall(SYS_PUTCHAR, c, 0, 0); }
 
+void console_write(const char *buf, size_t len) { syscall(SYS_WRITE, (int)buf, len, 0); }
+
 int getchar(void) { return syscall(SYS_GETCHAR, 0, 0, 0); }
 
+void prof_start(void) { syscall(SYS_PROF_START, 0, 0, 0); }
+
+void prof_stop(void) { syscall(SYS_PROF_STOP, 0, 0, 0); }
+
+void prof_dump(void) { syscall(SYS_PROF_DUMP, 0, 0, 0); }
+
+int getpid(void) { return syscall(SYS_GETPID, 0, 0, 0); }
+
+void yield(void) { syscall(SYS_YIELD, 0, 0, 0); }
+
+int spawn(const char *name) { return syscall(SYS_SPAWN, (int)name, 0, 0); }
+
+int wait(int pid) { return syscall(SYS_WAIT, pid, 0, 0); }
+
+void *sbrk(uint32_t n_pages) { return (void *)syscall(SYS_SBRK, n_pages, 0, 0); }
+
+int readdir(int index, struct dirent *dirent) { return syscall(SYS_READDIR, index, (int)dirent, 0); }
+
+int open(const char *name) { return syscall(SYS_OPEN, (int)name, 0, 0); }
+
+int read(int fd, void *buf, size_t len) { return syscall(SYS_READ, fd, (int)buf, len); }
+
+int close(int fd) { return syscall(SYS_CLOSE, fd, 0, 0); }
+
+/* low half of the time csr, TIMEBASE_HZ ticks per second, good for deltas up to ~7 minutes */
+uint32_t read_time(void) {
+    uint32_t t;
+    __asm__ __volatile__("csrr %0, time" : "=r"(t));
+    return t;
+}
+
 __attribute__((section(".text.start"))) __attribute__((naked)) void start(void) {
     __asm__ __volatile__("mv sp, %[stack_top] \n"
                          "call main           \n"
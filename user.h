@@ -3,4 +3,18 @@
 
 __attribute__((noreturn)) void exit(void);
 void putchar(char ch);
-int getchar(void);
\ No newline at end of file
+void console_write(const char *buf, size_t len);
+int getchar(void);
+void prof_start(void);
+void prof_stop(void);
+void prof_dump(void);
+int getpid(void);
+void yield(void);
+int spawn(const char *name);
+int wait(int pid);
+void *sbrk(uint32_t n_pages);
+uint32_t read_time(void);
+int readdir(int index, struct dirent *dirent);
+int open(const char *name);
+int read(int fd, void *buf, size_t len);
+int close(int fd);
\ No newline at end of file